@@ -59,6 +59,45 @@
 #define SA_SHIRQ IRQF_SHARED
 #endif
 
+/* __devinit and friends were removed in 3.8 */
+#ifndef __devinit
+#define __devinit
+#endif
+
+#ifndef __devexit
+#define __devexit
+#endif
+
+#ifndef __devinitdata
+#define __devinitdata
+#endif
+
+#ifndef __devexit_p
+#define __devexit_p(x) x
+#endif
+
+#ifndef __always_inline
+#define __always_inline inline
+#endif
+
+#ifndef SET_ETHTOOL_OPS
+#define SET_ETHTOOL_OPS(netdev, ops) ((netdev)->ethtool_ops = (ops))
+#endif
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3,19,0)
+#ifndef PREPARE_DELAYED_WORK
+#define PREPARE_DELAYED_WORK(_work, _func) ((_work)->work.func = (_func))
+#endif
+#endif
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4,7,0)
+#define netif_trans_update(dev) ((dev)->trans_start = jiffies)
+#endif
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,36)
+#define usleep_range(min, max)	msleep(DIV_ROUND_UP(min, 1000))
+#endif
+
 #ifndef NETIF_F_GSO
 #define gso_size	tso_size
 #define gso_segs	tso_segs
@@ -80,7 +119,7 @@
 	#endif
 
 	#define RTL_NET_DEVICE_OPS(ops)	dev->open=rtl8168_open; \
-					dev->hard_start_xmit=rtl8168_start_xmit; \
+					dev->hard_start_xmit=tp->start_xmit; \
 					dev->get_stats=rtl8168_get_stats; \
 					dev->stop=rtl8168_close; \
 					dev->tx_timeout=rtl8168_tx_timeout; \
@@ -130,6 +169,60 @@ This is free software, and you are welcome to redistribute it under certain cond
 #define TX_BUFFS_AVAIL(tp) \
 	(tp->dirty_tx + NUM_TX_DESC - tp->cur_tx - 1)
 
+/* Tx queue stop/wake hysteresis */
+#define R8168_TX_STOP_THRESH	(MAX_SKB_FRAGS + 1)
+#define R8168_TX_WAKE_THRESH	(NUM_TX_DESC / 4)
+
+/* Lazy Tx reclaim needs hrtimer_start_range_ns */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(2,6,28)
+#define R8168_TX_LAZY
+#endif
+#define R8168_TX_LAZY_BATCH	32	/* in-flight descriptors reclaimed by start_xmit */
+
+/* Software interrupt coalescing re-polls NAPI from an hrtimer */
+#if defined(CONFIG_R8168_NAPI) && (LINUX_VERSION_CODE >= KERNEL_VERSION(2,6,28))
+#define R8168_SW_COALESCE
+#endif
+#define R8168_SW_COALESCE_USECS	50	/* default on CFG_METHOD_1..3 */
+
+/* Software Rx flow hash for RPS/RFS */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(2,6,35)
+#define R8168_RX_HASH
+#endif
+
+/* Rx/Tx processing in a per-device kernel thread instead of softirq */
+#if defined(CONFIG_R8168_NAPI) && (LINUX_VERSION_CODE >= KERNEL_VERSION(2,6,24))
+#define R8168_POLL_THREAD
+#endif
+
+/* Tx ring packet generator driven through SIOCRTLTOOL */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(2,6,24)
+#define R8168_PKTGEN
+#endif
+#define R8168_PKTGEN_SLOTS	128	/* template copies, max frames in flight */
+#define R8168_PKTGEN_DRAIN_MS	100
+
+/* Let the driver core probe ports in parallel */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,2,0)
+#define R8168_ASYNC_PROBE
+#endif
+
+/* Socket busy polling (SO_BUSY_POLL) */
+#if defined(CONFIG_R8168_NAPI) && defined(CONFIG_NET_RX_BUSY_POLL) && \
+    (LINUX_VERSION_CODE >= KERNEL_VERSION(3,11,0))
+#define R8168_BUSY_POLL
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4,11,0)
+/* ndo_busy_poll and NAPI poll exclude each other through bp_state */
+#define R8168_BP_IDLE		0
+#define R8168_BP_NAPI		(1 << 0)	/* owned by rtl8168_poll */
+#define R8168_BP_POLL		(1 << 1)	/* owned by rtl8168_busy_poll */
+#define R8168_BP_LOCKED		(R8168_BP_NAPI | R8168_BP_POLL)
+#define R8168_BP_NAPI_YIELD	(1 << 2)
+#define R8168_BP_POLL_YIELD	(1 << 3)
+#define R8168_BP_DISABLED	(1 << 4)	/* rings being reset, keep off */
+#endif
+#endif
+
 #ifdef CONFIG_R8168_NAPI
 #define rtl8168_rx_skb			netif_receive_skb
 #define rtl8168_rx_hwaccel_skb		vlan_hwaccel_receive_skb
@@ -179,8 +272,20 @@ This is free software, and you are welcome to redistribute it under certain cond
 #define R8168_RX_RING_BYTES	(NUM_RX_DESC * sizeof(struct RxDesc))
 
 #define RTL8168_TX_TIMEOUT	(6 * HZ)
-#define RTL8168_LINK_TIMEOUT	(1 * HZ)
-#define RTL8168_ESD_TIMEOUT	(2 * HZ)
+#define RTL8168_LINK_PERIOD_MS	1000
+#define RTL8168_ESD_PERIOD_MS	2000
+
+#define R8168_RX_FILL_BATCH	64	/* Rx descriptors published per barrier */
+#define R8168_RX_RESERVE	16	/* preallocated Rx buffers for shortages */
+#define R8168_RX_REFILL_DELAY	(HZ / 50)
+#define R8168_RX_BATCH		32	/* frames harvested before delivery */
+
+/* Adaptive rx_copybreak */
+#define R8168_COPYBREAK_MAX	512	/* largest threshold picked by the adaptive mode */
+#define R8168_CB_SHIFT		6	/* 64 byte histogram buckets */
+#define R8168_CB_BUCKETS	(R8168_COPYBREAK_MAX >> R8168_CB_SHIFT)
+#define R8168_CB_WINDOW		1024	/* frames per adaptation step */
+#define R8168_CB_ALLOC_NS	1000	/* Rx buffer refill cost that makes copying win */
 
 #define NUM_TX_DESC	1024	/* Number of Tx descriptor registers */
 #define NUM_RX_DESC	1024	/* Number of Rx descriptor registers */
@@ -344,6 +449,18 @@ extern void __chk_io_ptr(void __iomem *);
 #define module_param(v,t,p) MODULE_PARM(v, "i");
 #endif
 
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,16)
+#define mutex			semaphore
+#define mutex_init(m)		init_MUTEX(m)
+#define mutex_lock(m)		down(m)
+#define mutex_unlock(m)		up(m)
+#define DEFINE_MUTEX(m)		DECLARE_MUTEX(m)
+#endif
+
+#ifndef DEFINE_SPINLOCK
+#define DEFINE_SPINLOCK(x) spinlock_t x = SPIN_LOCK_UNLOCKED
+#endif
+
 #ifndef PCI_DEVICE
 #define PCI_DEVICE(vend,dev) \
 	.vendor = (vend), .device = (dev), \
@@ -1130,18 +1247,183 @@ struct ring_info {
 	u8		__pad[sizeof(void *) - sizeof(u32)];
 };
 
+/* Config space dwords snapshotted at hw_start and checked by the ESD poll */
+#define R8168_PCI_CFG_SNAPSHOT_NUM	7
+
 struct pci_resource {
-	u8	cmd;
-	u8	cls;
-	u16	io_base_h;
-	u16	io_base_l;
-	u16	mem_base_h;
-	u16	mem_base_l;
-	u8	ilr;
-	u16	resv_0x20_h;
-	u16	resv_0x20_l;
-	u16	resv_0x24_h;
-	u16	resv_0x24_l;
+	u32	dword[R8168_PCI_CFG_SNAPSHOT_NUM];
+};
+
+/* Indirect register transactions counted for bring-up phase stats */
+enum rtl8168_io_type {
+	RTL_IO_MDIO = 0,
+	RTL_IO_EPHY,
+	RTL_IO_CSI,
+	RTL_IO_ERI,
+	RTL_IO_OCP,
+	RTL_IO_MAX,
+};
+
+/* Last run of a bring-up phase */
+struct rtl8168_phase_stats {
+	u64	runs;
+	u64	ns;
+	u64	mdio;
+	u64	ephy;
+	u64	csi;
+	u64	eri;
+	u64	ocp;
+};
+
+struct rtl8168_phase_mark {
+	u64	start_ns;
+	unsigned long io[RTL_IO_MAX];
+};
+
+/* Driver event counters, reported after the tally counters by ethtool -S */
+struct rtl8168_sw_stats {
+	u64	esd_events;
+	u64	pci_err_events;
+	u64	recover_count;
+	u64	recover_last_ns;
+	u64	recover_max_ns;
+	u64	fast_resets;
+	u64	full_resets;
+	u64	reset_last_ns;
+	u64	rx_fifo_overflows;
+	u64	rx_fifo_recover_lt_100us;
+	u64	rx_fifo_recover_lt_1ms;
+	u64	rx_fifo_recover_lt_10ms;
+	u64	rx_fifo_recover_ge_10ms;
+	u64	rx_frag_frames;
+	u64	rx_frag_errors;
+	u64	rx_refill_failures;
+	u64	rx_reserve_used;
+	u64	rx_stalls;
+	u64	rx_stall_last_ns;
+	u64	rx_stall_max_ns;
+	u64	rx_copied;
+	u64	rx_copybreak_updates;
+	u64	tx_lazy_timer_reclaims;
+	u64	sw_coalesce_polls;
+	u64	sw_coalesce_idle;
+	u64	rx_irq_packets;
+	u64	rx_busy_poll_packets;
+	u64	poll_thread_runs;
+	u64	poll_thread_busy_ns;
+	u64	hw_init_last_ns;
+	u64	init_replays;
+	u64	init_replay_mismatches;
+	u64	loopback_passes;
+	u64	loopback_failures;
+	u64	loopback_retries;
+	u64	loopback_max_ns;
+	u64	down_mask_retries;
+	u64	rings_reused;
+	struct rtl8168_phase_stats ph_probe;
+	struct rtl8168_phase_stats ph_phy_config;
+	struct rtl8168_phase_stats ph_driver_start;
+	struct rtl8168_phase_stats ph_loopback;
+	struct rtl8168_phase_stats ph_hw_start;
+	struct rtl8168_phase_stats ph_open;
+	struct rtl8168_phase_stats ph_down;
+	struct rtl8168_phase_stats ph_resume;
+};
+
+/* A completed Rx descriptor awaiting delivery */
+struct rtl8168_rx_slot {
+	u16	entry;
+	u16	len;
+};
+
+/*
+ * One step of a chip's hw_start init program.  Register steps write
+ * (src & ~clear) | set to reg; a clear mask covering the whole register
+ * skips the read.  For RTL_INIT_ERI, src is the access length.
+ */
+enum rtl8168_init_op_type {
+	RTL_INIT_END = 0,
+	RTL_INIT_MAC8,
+	RTL_INIT_MAC16,
+	RTL_INIT_EPHY,
+	RTL_INIT_CSI,
+	RTL_INIT_PCI8,
+	RTL_INIT_ERI,
+	RTL_INIT_CP_CMD,	/* tp->cp_cmd only, no register access */
+	RTL_INIT_CSUM,		/* set != 0 enables Rx/Tx checksum offload */
+};
+
+enum rtl8168_init_op_cond {
+	RTL_INIT_ANY = 0,
+	RTL_INIT_JUMBO,		/* dev->mtu > ETH_DATA_LEN */
+	RTL_INIT_STD,
+};
+
+struct rtl8168_init_op {
+	u8	type;
+	u8	cond;
+	u16	reg;
+	u16	src;
+	u32	clear;
+	u32	set;
+};
+
+#define R8168_INIT_JOURNAL_MAX	48
+
+/* nic_reset wait for the Tx poll bit to clear, in 20us steps */
+#define R8168_NPQ_WAIT_LOOPS	1000
+
+/* MAC loopback check run by hw_start on CFG_METHOD_11/12 */
+#define R8168_LB_TIMEOUT_MS	10	/* per attempt */
+#define R8168_LB_RETRIES	4
+
+/* ethtool -t offline loopback benchmark */
+#define R8168_ST_SAMPLES	200	/* latency samples per frame size */
+#define R8168_ST_BURST		1024	/* frames per throughput run */
+#define R8168_ST_WINDOW		(NUM_TX_DESC / 2)
+#define R8168_ST_TIMEOUT_NS	(10 * 1000 * 1000)
+#define R8168_ST_SPIN_NS	(20 * 1000)	/* then poll with sleeps */
+
+/*
+ * Registers read back after a journal replay to confirm it took.  Besides
+ * the MAC jumbo settings this covers the last CSI and EPHY steps the
+ * journal holds, so the replayed non-MAC writes are checked as well.
+ */
+struct rtl8168_init_verify {
+	u32	csi;
+	u16	csi_reg;	/* 0 = journal has no CSI step */
+	u16	ephy;
+	u8	ephy_reg;	/* 0xff = journal has no EPHY step */
+	u8	config3;
+	u8	config4;
+	u8	mtps;
+};
+
+#ifdef R8168_PKTGEN
+struct rtl8168_pktgen {
+	void		*buf[R8168_PKTGEN_SLOTS];
+	dma_addr_t	dma[R8168_PKTGEN_SLOTS];
+	u32		len;
+	u32		count;		/* frames to send, 0 = until stopped */
+	u16		seq_off;	/* __be32 sequence number, 0 = none */
+	u16		ts_off;		/* __be64 ns timestamp, 0 = none */
+	u32		full_wait_us;	/* half the ring's time on a 1G wire */
+	u32		base;		/* tp->cur_tx when the run started */
+	u32		cur;		/* frames posted */
+	u32		dirty;		/* frames completed */
+	u64		sent;
+	u64		start_ns;
+	u64		end_ns;
+};
+#endif
+
+/* MAC registers programmed by hw_start that a fast restart writes back */
+struct rtl8168_restart_regs {
+	u32	tx_config;
+	u16	cplus_cmd;
+	u16	rx_max_size;
+	u16	intr_mitigate;
+	u8	mtps;
 };
 
 struct rtl8168_private {
@@ -1160,6 +1442,13 @@ struct rtl8168_private {
 	u32 tx_tcp_csum_cmd;
 	u32 tx_udp_csum_cmd;
 	u32 tx_ip_csum_cmd;
+	/* packet paths built for this chip's checksum layout */
+	int (*start_xmit)(struct sk_buff *, struct net_device *);
+	int (*rx_interrupt)(struct net_device *, struct rtl8168_private *,
+			    void __iomem *, u32);
+#ifdef HAVE_NET_DEVICE_OPS
+	struct net_device_ops netdev_ops;
+#endif
 	int max_jumbo_frame_size;
 	int chipset;
 	u32 mcfg;
@@ -1172,15 +1461,32 @@ struct rtl8168_private {
 	dma_addr_t TxPhyAddr;
 	dma_addr_t RxPhyAddr;
 	struct sk_buff *Rx_skbuff[NUM_RX_DESC];	/* Rx data buffers */
+	struct sk_buff *rx_head_skb;	/* frame spanning several descriptors */
+	struct sk_buff *rx_tail_skb;	/* last skb on rx_head_skb's frag_list */
 	struct ring_info tx_skb[NUM_TX_DESC];	/* Tx data buffers */
 	unsigned rx_buf_sz;
 	int rx_fifo_overflow;
-	struct timer_list esd_timer;
-	struct timer_list link_timer;
+	struct list_head hk_node;	/* on rtl8168_hk_ports while open */
+	unsigned long hk_esd_next;	/* jiffies of the next ESD check */
+	unsigned long hk_link_next;	/* jiffies of the next link poll */
 	int old_link_status;
 	struct pci_resource pci_cfg_space;
 	unsigned int esd_flag;
 	unsigned int pci_cfg_is_read;
+	unsigned int phy_config_pending;	/* PHY tuning deferred to open */
+	u64 recover_start_ns;
+	struct rtl8168_sw_stats sw_stats;
+	unsigned long io_ops[RTL_IO_MAX];	/* indirect accesses to this port */
+	struct rtl8168_restart_regs restart_regs;
+	unsigned int full_reset_pending;
+	unsigned int io_stopped;	/* datapath stopped for a PCI error */
+	/* hw_start init writes recorded on the first bring-up */
+	struct rtl8168_init_op init_journal[R8168_INIT_JOURNAL_MAX + 1];
+	struct rtl8168_init_verify init_verify;
+	u8 init_journal_len;
+	u8 init_journal_valid;
+	u8 init_journal_jumbo;
+	u8 init_replay;
 	unsigned int rtl8168_rx_config;
 	u16 cp_cmd;
 	u16 intr_mask;
@@ -1208,6 +1514,51 @@ struct rtl8168_private {
 	struct work_struct task;
 #else
 	struct delayed_work task;
+#endif
+	struct work_struct rx_fifo_task;
+	struct mutex recover_mutex;	/* reset_task, rx_fifo_task, change_mtu */
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,20)
+	struct work_struct rx_refill_task;
+#else
+	struct delayed_work rx_refill_task;
+#endif
+	unsigned int rx_refill_pending;
+	u64 rx_stall_start_ns;
+	spinlock_t rx_reserve_lock;
+	struct sk_buff *rx_reserve[R8168_RX_RESERVE];
+	int rx_reserve_cnt;
+	unsigned rx_reserve_sz;
+	int rx_copybreak;
+	unsigned int rx_copybreak_auto;
+	u32 cb_frames;
+	u32 cb_fill_ns;
+	u32 cb_fill_cnt;
+	u16 cb_hist[R8168_CB_BUCKETS];
+	spinlock_t tx_reclaim_lock;
+	unsigned int tx_lazy_usecs;	/* 0: TxOK interrupts */
+#ifdef R8168_TX_LAZY
+	struct hrtimer tx_timer;
+	unsigned long tx_timer_pending;	/* bit 0: tx_timer armed or running */
+#endif
+	unsigned int sw_coal_usecs;	/* 0: unmask after every poll */
+	unsigned int sw_coal_frames;
+#ifdef R8168_SW_COALESCE
+	struct hrtimer coal_timer;
+#endif
+#ifdef R8168_POLL_THREAD
+	struct task_struct *poll_task;
+	struct mutex poll_thread_mutex;
+	unsigned int poll_thread_pending;
+	unsigned int poll_thread_off;
+#endif
+#ifdef R8168_PKTGEN
+	struct task_struct *pktgen_task;
+	struct rtl8168_pktgen *pktgen;
+	unsigned int pktgen_active;
+#endif
+#if defined(R8168_BUSY_POLL) && (LINUX_VERSION_CODE < KERNEL_VERSION(4,11,0))
+	spinlock_t bp_lock;
+	unsigned int bp_state;
 #endif
 	unsigned features;
 };
@@ -1239,8 +1590,8 @@ enum mcfg {
 	CFG_METHOD_UNKNOWN = 0xFFFFFFFFUL
 };
 
-extern u32 rtl8168_eri_read(void __iomem *ioaddr, int addr, int len, int type);
-extern int rtl8168_eri_write(void __iomem *ioaddr, int addr, int len, u32 value, int type);
+extern u32 rtl8168_eri_read(struct rtl8168_private *tp, int addr, int len, int type);
+extern int rtl8168_eri_write(struct rtl8168_private *tp, int addr, int len, u32 value, int type);
 
 #define OOB_CMD_RESET		0x00
 #define OOB_CMD_DRIVER_START	0x05
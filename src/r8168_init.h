@@ -0,0 +1,442 @@
+/*
+################################################################################
+# 
+# r8168 is the Linux device driver released for RealTek RTL8168B/8111B, 
+# RTL8168C/8111C, RTL8168CP/8111CP, RTL8168D/8111D, and RTL8168DP/8111DP, and
+# RTK8168E/8111E Gigabit Ethernet controllers with PCI-Express interface.
+# 
+# Copyright(c) 2010 Realtek Semiconductor Corp. All rights reserved.
+# 
+# This program is free software; you can redistribute it and/or modify it
+# under the terms of the GNU General Public License as published by the Free
+# Software Foundation; either version 2 of the License, or (at your option)
+# any later version.
+# 
+# This program is distributed in the hope that it will be useful, but WITHOUT
+# ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+# FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+# more details.
+# 
+# You should have received a copy of the GNU General Public License along with
+# this program; if not, see <http://www.gnu.org/licenses/>.
+# 
+# Author:
+# Realtek NIC software team <nicfae@realtek.com>
+# No. 2, Innovation Road II, Hsinchu Science Park, Hsinchu 300, Taiwan
+# 
+################################################################################
+*/
+
+/*
+ * This product is covered by one or more of the following patents:
+ * US5,307,459, US5,434,872, US5,732,094, US6,570,884, US6,115,776, and US6,327,625.
+ */
+
+#ifndef _LINUX_R8168_INIT_H
+#define _LINUX_R8168_INIT_H
+
+/*
+ * hw_start init programs and their interpreter.  Included by r8168_n.c
+ * after the EPHY/CSI/ERI accessors, and by test/hw_start, which replays
+ * every program against a register model and diffs the writes with the
+ * original per-chip code.
+ */
+
+/*
+ * Per-chip hw_start init programs.  Each table is replayed in order by
+ * rtl8168_run_init_prog(); keep the step order identical to the vendor
+ * bring-up sequence when editing.
+ */
+#define INIT_OP(t, c, r, s, cl, st)	{ RTL_INIT_##t, RTL_INIT_##c, r, s, cl, st }
+#define MAC8(c, r, cl, st)		INIT_OP(MAC8, c, r, r, cl, st)
+#define MAC8_W(c, r, v)			INIT_OP(MAC8, c, r, r, 0xff, v)
+#define MAC16(c, r, cl, st)		INIT_OP(MAC16, c, r, r, cl, st)
+#define EPHY(r, cl, st)			INIT_OP(EPHY, ANY, r, r, cl, st)
+#define EPHY_W(r, v)			INIT_OP(EPHY, ANY, r, r, 0xffff, v)
+#define PCI8(c, r, cl, st)		INIT_OP(PCI8, c, r, r, cl, st)
+#define PCI8_W(c, r, v)			INIT_OP(PCI8, c, r, r, 0xff, v)
+#define CSUM(c, on)			INIT_OP(CSUM, c, 0, 0, 0, on)
+#define INIT_END			INIT_OP(END, ANY, 0, 0, 0, 0)
+
+/*set PCI configuration space offset 0x70F to v*/
+/*When the register offset of PCI configuration space larger than 0xff, use CSI to access it.*/
+#define CSI_70F(v)	INIT_OP(CSI, ANY, 0x70c, 0x70c, 0xff000000, (v) << 24)
+
+/* disable clock request. */
+#define CLKREQ_OFF	PCI8_W(ANY, 0x81, 0x00)
+
+#define CPLUS_DBG_OFF	MAC16(ANY, CPlusCmd, EnableBist | Macdbgo_oe | Force_halfdup | \
+			      Force_rxflow_en | Force_txflow_en | Cxpl_dbg_sel | \
+			      ASF | PktCntrDisable | Macdbgo_sel, 0)
+
+#define BEACON_OFF	MAC8(ANY, Config3, Beacon_en, 0)
+
+/* Jumbo enable, PCIe max read request (0x79) and checksum offload by MTU */
+#define JUMBO_CFG \
+	MAC8_W(ANY, MTPS, Reserved1_data), \
+	MAC8(JUMBO, Config3, 0, Jumbo_En0), \
+	MAC8(JUMBO, Config4, 0, Jumbo_En1), \
+	PCI8(JUMBO, 0x79, 0x70, 0x20), \
+	CSUM(JUMBO, 0), \
+	MAC8(STD, Config3, Jumbo_En0, 0), \
+	MAC8(STD, Config4, Jumbo_En1, 0), \
+	PCI8(STD, 0x79, 0x70, 0x50), \
+	CSUM(STD, 1)
+
+/* 8168DP only has Jumbo_En0; 0x79 is set separately */
+#define JUMBO_CFG_DP \
+	MAC8_W(ANY, MTPS, Reserved1_data), \
+	MAC8(JUMBO, Config3, 0, Jumbo_En0), \
+	CSUM(JUMBO, 0), \
+	MAC8(STD, Config3, Jumbo_En0, 0), \
+	CSUM(STD, 1)
+
+#define CONFIG1_LEDS	MAC8(ANY, Config1, 0x3F, 0x1F)
+
+static const struct rtl8168_init_op rtl8168_init_cfg1[] = {
+	BEACON_OFF,
+	CPLUS_DBG_OFF,
+	PCI8(JUMBO, 0x69, 0x70, 0x28),
+	PCI8(STD, 0x69, 0x70, 0x58),
+	INIT_END
+};
+
+/* CFG_METHOD_2 and CFG_METHOD_3 */
+static const struct rtl8168_init_op rtl8168_init_cfg2[] = {
+	BEACON_OFF,
+	CPLUS_DBG_OFF,
+	MAC8_W(ANY, MTPS, Reserved1_data),
+	PCI8(JUMBO, 0x69, 0x70, 0x28),
+	MAC8(JUMBO, Config4, 0, 1 << 0),
+	PCI8(STD, 0x69, 0x70, 0x58),
+	MAC8(STD, Config4, 1 << 0, 0),
+	INIT_END
+};
+
+static const struct rtl8168_init_op rtl8168_init_cfg4[] = {
+	CSI_70F(0x27),
+	MAC8_W(ANY, DBG_reg, (0x0E << 4) | Fix_Nak_1 | Fix_Nak_2),
+	EPHY(0x02, 1 << 11, 1 << 12),
+	EPHY(0x03, 0, 1 << 1),
+	EPHY(0x06, 1 << 7, 0),
+	BEACON_OFF,
+	CLKREQ_OFF,
+	CPLUS_DBG_OFF,
+	JUMBO_CFG,
+	INIT_END
+};
+
+static const struct rtl8168_init_op rtl8168_init_cfg5[] = {
+	CSI_70F(0x27),
+	/* RTL8168CP EPHY */
+	EPHY(0x01, 0, 1 << 0),
+	EPHY(0x03, 1 << 10, (1 << 9) | (1 << 5)),
+	BEACON_OFF,
+	CLKREQ_OFF,
+	CPLUS_DBG_OFF,
+	JUMBO_CFG,
+	INIT_END
+};
+
+static const struct rtl8168_init_op rtl8168_init_cfg6[] = {
+	CSI_70F(0x27),
+	BEACON_OFF,
+	CLKREQ_OFF,
+	CPLUS_DBG_OFF,
+	JUMBO_CFG,
+	INIT_END
+};
+
+static const struct rtl8168_init_op rtl8168_init_cfg7[] = {
+	CSI_70F(0x27),
+	INIT_OP(ERI, ANY, 0x1EC, 1, 0, 0x07),
+	CLKREQ_OFF,
+	CPLUS_DBG_OFF,
+	BEACON_OFF,
+	JUMBO_CFG,
+	INIT_END
+};
+
+static const struct rtl8168_init_op rtl8168_init_cfg8[] = {
+	CSI_70F(0x27),
+	INIT_OP(ERI, ANY, 0x1EC, 1, 0, 0x07),
+	CLKREQ_OFF,
+	CPLUS_DBG_OFF,
+	BEACON_OFF,
+	MAC8_W(ANY, 0xD1, 0x20),
+	JUMBO_CFG,
+	INIT_END
+};
+
+static const struct rtl8168_init_op rtl8168_init_cfg9[] = {
+	CSI_70F(0x13),
+	CLKREQ_OFF,
+	MAC8(ANY, Config3, BIT_4, 0),
+	MAC8(ANY, DBG_reg, 0, BIT_7 | BIT_1),
+	JUMBO_CFG,
+	EPHY_W(0x01, 0x7C7D),
+	EPHY_W(0x02, 0x091F),
+	EPHY_W(0x06, 0xB271),
+	EPHY_W(0x07, 0xCE00),
+	INIT_END
+};
+
+static const struct rtl8168_init_op rtl8168_init_cfg10[] = {
+	CSI_70F(0x13),
+	MAC8(ANY, DBG_reg, 0, BIT_7 | BIT_1),
+	JUMBO_CFG,
+	CONFIG1_LEDS,
+	EPHY_W(0x01, 0x6C7F),
+	EPHY_W(0x02, 0x011F),
+	EPHY_W(0x03, 0xC1B2),
+	EPHY_W(0x1A, 0x0546),
+	EPHY_W(0x1C, 0x80C4),
+	EPHY_W(0x1D, 0x78E4),
+	EPHY_W(0x0A, 0x8100),
+	CLKREQ_OFF,
+	MAC8(ANY, 0xF3, 0, BIT_2),
+	INIT_END
+};
+
+static const struct rtl8168_init_op rtl8168_init_cfg11[] = {
+	CSI_70F(0x17),
+	PCI8(ANY, 0x79, 0x70, 0x50),
+	JUMBO_CFG_DP,
+	CLKREQ_OFF,
+	CONFIG1_LEDS,
+	INIT_END
+};
+
+static const struct rtl8168_init_op rtl8168_init_cfg12[] = {
+	CSI_70F(0x17),
+	PCI8(ANY, 0x79, 0x70, 0x50),
+	JUMBO_CFG_DP,
+	/* EPHY 0x03 is built from 0x0B, 0x19 and 0x0C in turn */
+	INIT_OP(EPHY, ANY, 0x03, 0x0B, 0, 0x48),
+	INIT_OP(EPHY, ANY, 0x03, 0x19, 0xffff & ~0x20, 0x50),
+	INIT_OP(EPHY, ANY, 0x03, 0x0C, 0, 0x20),
+	PCI8_W(ANY, 0x81, 0x01),
+	CONFIG1_LEDS,
+	INIT_END
+};
+
+/* CFG_METHOD_14 and CFG_METHOD_15 */
+static const struct rtl8168_init_op rtl8168_init_cfg14[] = {
+	CSI_70F(0x27),
+	EPHY(0x00, 0x0200, 0x0100),
+	EPHY(0x00, 0, 0x0004),
+	EPHY(0x06, 0x0002, 0x0001),
+	EPHY(0x06, 0, 0x0030),
+	EPHY(0x07, 0, 0x2000),
+	EPHY(0x00, 0, 0x0020),
+	EPHY(0x03, 0x5800, 0x2000),
+	EPHY(0x03, 0, 0x0001),
+	EPHY(0x01, 0x0800, 0x1000),
+	EPHY(0x07, 0, 0x4000),
+	EPHY(0x1E, 0, 0x2000),
+	EPHY_W(0x19, 0xFE6C),
+	EPHY(0x0A, 0, 0x0040),
+	INIT_OP(CP_CMD, ANY, 0, 0, (u16)~0x2063, 0),
+	MAC8_W(JUMBO, MTPS, 0x24),
+	MAC8(JUMBO, Config3, 0, Jumbo_En0),
+	MAC8(JUMBO, Config4, 0, 0x01),
+	PCI8_W(JUMBO, 0x79, 0x20),
+	CSUM(JUMBO, 0),
+	MAC8_W(STD, MTPS, 0x0C),
+	MAC8(STD, Config3, Jumbo_En0, 0),
+	MAC8(STD, Config4, 0x01, 0),
+	PCI8_W(STD, 0x79, 0x50),
+	CSUM(STD, 1),
+	MAC8(ANY, 0xF3, 0, BIT_5),
+	MAC8(ANY, 0xF3, BIT_5, 0),
+	MAC8(ANY, 0xD0, 0, BIT_7 | BIT_6),
+	MAC8(ANY, 0xF1, 0, BIT_7 | BIT_6 | BIT_5 | BIT_4 | BIT_2 | BIT_1),
+	MAC8(ANY, Config5, 0x08, BIT_0),
+	MAC8(ANY, Config2, 0, BIT_7),
+	BEACON_OFF,
+	INIT_END
+};
+
+#undef CONFIG1_LEDS
+#undef JUMBO_CFG_DP
+#undef JUMBO_CFG
+#undef BEACON_OFF
+#undef CPLUS_DBG_OFF
+#undef CLKREQ_OFF
+#undef CSI_70F
+#undef INIT_END
+#undef CSUM
+#undef PCI8_W
+#undef PCI8
+#undef EPHY_W
+#undef EPHY
+#undef MAC16
+#undef MAC8_W
+#undef MAC8
+#undef INIT_OP
+
+static const struct rtl8168_init_op *const rtl8168_init_progs[CFG_METHOD_MAX] = {
+	[CFG_METHOD_1] = rtl8168_init_cfg1,
+	[CFG_METHOD_2] = rtl8168_init_cfg2,
+	[CFG_METHOD_3] = rtl8168_init_cfg2,
+	[CFG_METHOD_4] = rtl8168_init_cfg4,
+	[CFG_METHOD_5] = rtl8168_init_cfg5,
+	[CFG_METHOD_6] = rtl8168_init_cfg6,
+	[CFG_METHOD_7] = rtl8168_init_cfg7,
+	[CFG_METHOD_8] = rtl8168_init_cfg8,
+	[CFG_METHOD_9] = rtl8168_init_cfg9,
+	[CFG_METHOD_10] = rtl8168_init_cfg10,
+	[CFG_METHOD_11] = rtl8168_init_cfg11,
+	[CFG_METHOD_12] = rtl8168_init_cfg12,
+	[CFG_METHOD_14] = rtl8168_init_cfg14,
+	[CFG_METHOD_15] = rtl8168_init_cfg14,
+};
+
+static const char * const rtl8168_init_op_names[] = {
+	[RTL_INIT_END] = "end",
+	[RTL_INIT_MAC8] = "mac8",
+	[RTL_INIT_MAC16] = "mac16",
+	[RTL_INIT_EPHY] = "ephy",
+	[RTL_INIT_CSI] = "csi",
+	[RTL_INIT_PCI8] = "pci8",
+	[RTL_INIT_ERI] = "eri",
+	[RTL_INIT_CP_CMD] = "cp_cmd",
+	[RTL_INIT_CSUM] = "csum",
+};
+
+/*
+ * Append the effective form of a step to the init journal.  Register
+ * steps become plain writes of the value that was written, so a replay
+ * skips the slow EPHY/CSI read polls; software steps are kept as-is.
+ */
+static void
+rtl8168_init_journal_add(struct rtl8168_private *tp,
+			 const struct rtl8168_init_op *op,
+			 u32 val)
+{
+	struct rtl8168_init_op *j;
+
+	if (tp->init_journal_len >= R8168_INIT_JOURNAL_MAX) {
+		tp->init_journal_valid = 0;
+		return;
+	}
+
+	j = &tp->init_journal[tp->init_journal_len++];
+	*j = *op;
+	j->cond = RTL_INIT_ANY;
+
+	switch (op->type) {
+	case RTL_INIT_MAC8:
+	case RTL_INIT_PCI8:
+		j->clear = 0xff;
+		break;
+	case RTL_INIT_MAC16:
+	case RTL_INIT_EPHY:
+		j->clear = 0xffff;
+		break;
+	case RTL_INIT_CSI:
+		j->clear = 0xffffffff;
+		break;
+	default:
+		return;
+	}
+
+	j->src = op->reg;
+	j->set = val;
+}
+
+/*
+ * Replay an init program.  With hw messages enabled (ethtool msglvl)
+ * every step is logged with the value written and its duration, which
+ * gives a register write trace that can be diffed between builds.
+ */
+static void
+rtl8168_run_init_prog(struct rtl8168_private *tp,
+		      const struct rtl8168_init_op *op,
+		      int record)
+{
+	struct net_device *dev = tp->dev;
+	struct pci_dev *pdev = tp->pci_dev;
+	void __iomem *ioaddr = tp->mmio_addr;
+	int jumbo = dev->mtu > ETH_DATA_LEN;
+	int trace = netif_msg_hw(tp);
+	u64 start, t0 = 0;
+	u8 byte;
+	u32 val;
+	int step;
+
+	start = rtl8168_get_time_ns();
+
+	for (step = 0; op->type != RTL_INIT_END; op++, step++) {
+		if ((op->cond == RTL_INIT_JUMBO && !jumbo) ||
+		    (op->cond == RTL_INIT_STD && jumbo))
+			continue;
+
+		if (trace)
+			t0 = rtl8168_get_time_ns();
+
+		switch (op->type) {
+		case RTL_INIT_MAC8:
+			val = (op->clear == 0xff) ? 0 : RTL_R8(op->src);
+			val = (val & ~op->clear) | op->set;
+			RTL_W8(op->reg, val);
+			break;
+		case RTL_INIT_MAC16:
+			val = (op->clear == 0xffff) ? 0 : RTL_R16(op->src);
+			val = (val & ~op->clear) | op->set;
+			RTL_W16(op->reg, val);
+			break;
+		case RTL_INIT_EPHY:
+			val = (op->clear == 0xffff) ? 0 : rtl8168_ephy_read(tp, op->src);
+			val = (val & ~op->clear) | op->set;
+			rtl8168_ephy_write(tp, op->reg, val);
+			break;
+		case RTL_INIT_CSI:
+			val = (op->clear == 0xffffffff) ? 0 : rtl8168_csi_read(tp, op->src);
+			val = (val & ~op->clear) | op->set;
+			rtl8168_csi_write(tp, op->reg, val);
+			break;
+		case RTL_INIT_PCI8:
+			byte = 0;
+			if (op->clear != 0xff)
+				pci_read_config_byte(pdev, op->src, &byte);
+			val = (byte & ~op->clear) | op->set;
+			pci_write_config_byte(pdev, op->reg, val);
+			break;
+		case RTL_INIT_ERI:
+			val = op->set;
+			rtl8168_eri_write(tp, op->reg, op->src, val, ERIAR_ASF);
+			break;
+		case RTL_INIT_CP_CMD:
+			tp->cp_cmd = (tp->cp_cmd & ~op->clear) | op->set;
+			val = tp->cp_cmd;
+			break;
+		case RTL_INIT_CSUM:
+			if (op->set) {
+				dev->features |= NETIF_F_IP_CSUM;
+				tp->cp_cmd |= RxChkSum;
+			} else {
+				dev->features &= ~NETIF_F_IP_CSUM;
+				tp->cp_cmd &= ~RxChkSum;
+			}
+			val = tp->cp_cmd;
+			RTL_W16(CPlusCmd, tp->cp_cmd);
+			break;
+		default:
+			continue;
+		}
+
+		if (record)
+			rtl8168_init_journal_add(tp, op, val);
+
+		if (trace)
+			printk(KERN_DEBUG "%s: init %2d %-6s %#06x <- %#010x %llu ns\n",
+			       dev->name, step, rtl8168_init_op_names[op->type],
+			       op->reg, val,
+			       (unsigned long long)(rtl8168_get_time_ns() - t0));
+	}
+
+	tp->sw_stats.hw_init_last_ns = rtl8168_get_time_ns() - start;
+}
+
+#endif /* _LINUX_R8168_INIT_H */
@@ -12,9 +12,18 @@ enum rtl_cmd {
 	RTLTOOL_WRITE_EPHY,
 //	RTLTOOL_READ_EEPROM,
 //	RTLTOOL_WRITE_EEPROM,
+	RTLTOOL_READ_COPYBREAK,
+	RTLTOOL_WRITE_COPYBREAK,
+	RTLTOOL_PKTGEN_START,
+	RTLTOOL_PKTGEN_STOP,
+	RTLTOOL_PKTGEN_STATUS,
 	RTLTOOL_INVALID
 };
 
+/*
+ * RTLTOOL_READ_COPYBREAK/RTLTOOL_WRITE_COPYBREAK: data is the rx copybreak
+ * threshold in bytes and a non-zero len selects the adaptive mode.
+ */
 struct rtltool_cmd {
 	__u32	cmd;
 	__u32	offset;
@@ -22,6 +31,28 @@ struct rtltool_cmd {
 	__u32	data;
 };
 
+/*
+ * RTLTOOL_PKTGEN_*: ifr_data points to a struct rtltool_pktgen instead.
+ * START sends count copies (0 = until STOP) of the len byte template in
+ * frame, writing the frame number as a big endian __u32 at seq_off and a
+ * ns timestamp as a big endian __u64 at ts_off (0 = leave alone).  All
+ * three commands return the status fields; frame is only read by START.
+ */
+struct rtltool_pktgen {
+	__u32	cmd;
+	__u32	len;
+	__u32	count;
+	__u16	seq_off;
+	__u16	ts_off;
+	__u32	running;
+	__u32	reserved;
+	__u64	sent;
+	__u64	elapsed_ns;
+	__u64	pps;
+	__u64	bytes_ps;
+	__u8	frame[1514];
+};
+
 enum mode_access {
 	MODE_NONE=0,
 	MODE_READ,
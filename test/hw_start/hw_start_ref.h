@@ -0,0 +1,675 @@
+/*
+ * Per-chip section of rtl8168_hw_start() as it was before the init
+ * programs in r8168_init.h replaced it.  Kept as the reference the
+ * tables are checked against; only accessor signature changes are
+ * carried over, never edits to match the tables.
+ */
+
+static void
+rtl8168_hw_start_ref(struct rtl8168_private *tp)
+{
+	struct net_device *dev = tp->dev;
+	void __iomem *ioaddr = tp->mmio_addr;
+	struct pci_dev *pdev = tp->pci_dev;
+	u8 device_control;
+	u16 ephy_data;
+	u32 csi_tmp;
+
+	if (tp->mcfg == CFG_METHOD_4) {
+		/*set PCI configuration space offset 0x70F to 0x27*/
+		/*When the register offset of PCI configuration space larger than 0xff, use CSI to access it.*/
+		csi_tmp = rtl8168_csi_read(tp, 0x70c) & 0x00ffffff;
+		rtl8168_csi_write(tp, 0x70c, csi_tmp | 0x27000000);
+
+		RTL_W8(DBG_reg, (0x0E << 4) | Fix_Nak_1 | Fix_Nak_2);
+
+		/*Set EPHY registers	begin*/
+		/*Set EPHY register offset 0x02 bit 11 to 0 and bit 12 to 1*/
+		ephy_data = rtl8168_ephy_read(tp, 0x02);
+		ephy_data &= ~(1 << 11);
+		ephy_data |= (1 << 12);
+		rtl8168_ephy_write(tp, 0x02, ephy_data);
+
+		/*Set EPHY register offset 0x03 bit 1 to 1*/
+		ephy_data = rtl8168_ephy_read(tp, 0x03);
+		ephy_data |= (1 << 1);
+		rtl8168_ephy_write(tp, 0x03, ephy_data);
+
+		/*Set EPHY register offset 0x06 bit 7 to 0*/
+		ephy_data = rtl8168_ephy_read(tp, 0x06);
+		ephy_data &= ~(1 << 7);
+		rtl8168_ephy_write(tp, 0x06, ephy_data);
+		/*Set EPHY registers	end*/
+
+		RTL_W8(Config3, RTL_R8(Config3) & ~Beacon_en);
+
+		//disable clock request.
+		pci_write_config_byte(pdev, 0x81, 0x00);
+
+		RTL_W16(CPlusCmd, RTL_R16(CPlusCmd) &
+			~(EnableBist | Macdbgo_oe | Force_halfdup | Force_rxflow_en | Force_txflow_en |
+			  Cxpl_dbg_sel | ASF | PktCntrDisable | Macdbgo_sel));
+
+		RTL_W8(MTPS, Reserved1_data);
+		if (dev->mtu > ETH_DATA_LEN) {
+			RTL_W8(Config3, RTL_R8(Config3) | Jumbo_En0);
+			RTL_W8(Config4, RTL_R8(Config4) | Jumbo_En1);
+
+			//Set PCI configuration space offset 0x79 to 0x20
+			/*Increase the Tx performance*/
+			pci_read_config_byte(pdev, 0x79, &device_control);
+			device_control &= ~0x70;
+			device_control |= 0x20;
+			pci_write_config_byte(pdev, 0x79, device_control);
+
+			//tx checksum offload disable
+			dev->features &= ~NETIF_F_IP_CSUM;
+
+			//rx checksum offload disable
+			tp->cp_cmd &= ~RxChkSum;
+			RTL_W16(CPlusCmd, tp->cp_cmd);
+		} else {
+			RTL_W8(Config3, RTL_R8(Config3) & ~Jumbo_En0);
+			RTL_W8(Config4, RTL_R8(Config4) & ~Jumbo_En1);
+
+			//Set PCI configuration space offset 0x79 to 0x50
+			/*Increase the Tx performance*/
+			pci_read_config_byte(pdev, 0x79, &device_control);
+			device_control &= ~0x70;
+			device_control |= 0x50;
+			pci_write_config_byte(pdev, 0x79, device_control);
+
+			//tx checksum offload enable
+			dev->features |= NETIF_F_IP_CSUM;
+
+			//rx checksum offload enable
+			tp->cp_cmd |= RxChkSum;
+			RTL_W16(CPlusCmd, tp->cp_cmd);
+		}
+	} else if (tp->mcfg == CFG_METHOD_5) {
+		/*set PCI configuration space offset 0x70F to 0x27*/
+		/*When the register offset of PCI configuration space larger than 0xff, use CSI to access it.*/
+		csi_tmp = rtl8168_csi_read(tp, 0x70c) & 0x00ffffff;
+		rtl8168_csi_write(tp, 0x70c, csi_tmp | 0x27000000);
+
+		/******set EPHY registers for RTL8168CP	begin******/
+		//Set EPHY register offset 0x01 bit 0 to 1.
+		ephy_data = rtl8168_ephy_read(tp, 0x01);
+		ephy_data |= (1 << 0);
+		rtl8168_ephy_write(tp, 0x01, ephy_data);
+
+		//Set EPHY register offset 0x03 bit 10 to 0, bit 9 to 1 and bit 5 to 1.
+		ephy_data = rtl8168_ephy_read(tp, 0x03);
+		ephy_data &= ~(1 << 10);
+		ephy_data |= (1 << 9);
+		ephy_data |= (1 << 5);
+		rtl8168_ephy_write(tp, 0x03, ephy_data);
+		/******set EPHY registers for RTL8168CP	end******/
+
+		RTL_W8(Config3, RTL_R8(Config3) & ~Beacon_en);
+
+		//disable clock request.
+		pci_write_config_byte(pdev, 0x81, 0x00);
+
+		RTL_W16(CPlusCmd, RTL_R16(CPlusCmd) &
+			~(EnableBist | Macdbgo_oe | Force_halfdup | Force_rxflow_en | Force_txflow_en |
+			  Cxpl_dbg_sel | ASF | PktCntrDisable | Macdbgo_sel));
+
+		RTL_W8(MTPS, Reserved1_data);
+		if (dev->mtu > ETH_DATA_LEN) {
+			RTL_W8(Config3, RTL_R8(Config3) | Jumbo_En0);
+			RTL_W8(Config4, RTL_R8(Config4) | Jumbo_En1);
+
+			//Set PCI configuration space offset 0x79 to 0x20
+			/*Increase the Tx performance*/
+			pci_read_config_byte(pdev, 0x79, &device_control);
+			device_control &= ~0x70;
+			device_control |= 0x20;
+			pci_write_config_byte(pdev, 0x79, device_control);
+
+			//tx checksum offload disable
+			dev->features &= ~NETIF_F_IP_CSUM;
+
+			//rx checksum offload disable
+			tp->cp_cmd &= ~RxChkSum;
+			RTL_W16(CPlusCmd, tp->cp_cmd);
+		} else {
+			RTL_W8(Config3, RTL_R8(Config3) & ~Jumbo_En0);
+			RTL_W8(Config4, RTL_R8(Config4) & ~Jumbo_En1);
+
+			//Set PCI configuration space offset 0x79 to 0x50
+			/*Increase the Tx performance*/
+			pci_read_config_byte(pdev, 0x79, &device_control);
+			device_control &= ~0x70;
+			device_control |= 0x50;
+			pci_write_config_byte(pdev, 0x79, device_control);
+
+			//tx checksum offload enable
+			dev->features |= NETIF_F_IP_CSUM;
+
+			//rx checksum offload enable
+			tp->cp_cmd |= RxChkSum;
+			RTL_W16(CPlusCmd, tp->cp_cmd);
+		}
+	} else if (tp->mcfg == CFG_METHOD_6) {
+		/*set PCI configuration space offset 0x70F to 0x27*/
+		/*When the register offset of PCI configuration space larger than 0xff, use CSI to access it.*/
+		csi_tmp = rtl8168_csi_read(tp, 0x70c) & 0x00ffffff;
+		rtl8168_csi_write(tp, 0x70c, csi_tmp | 0x27000000);
+
+		RTL_W8(Config3, RTL_R8(Config3) & ~Beacon_en);
+
+		//disable clock request.
+		pci_write_config_byte(pdev, 0x81, 0x00);
+
+		RTL_W16(CPlusCmd, RTL_R16(CPlusCmd) &
+			~(EnableBist | Macdbgo_oe | Force_halfdup | Force_rxflow_en | Force_txflow_en |
+			  Cxpl_dbg_sel | ASF | PktCntrDisable | Macdbgo_sel));
+
+		RTL_W8(MTPS, Reserved1_data);
+		if (dev->mtu > ETH_DATA_LEN) {
+			RTL_W8(Config3, RTL_R8(Config3) | Jumbo_En0);
+			RTL_W8(Config4, RTL_R8(Config4) | Jumbo_En1);
+
+			//Set PCI configuration space offset 0x79 to 0x20
+			/*Increase the Tx performance*/
+			pci_read_config_byte(pdev, 0x79, &device_control);
+			device_control &= ~0x70;
+			device_control |= 0x20;
+			pci_write_config_byte(pdev, 0x79, device_control);
+
+			//tx checksum offload disable
+			dev->features &= ~NETIF_F_IP_CSUM;
+
+			//rx checksum offload disable
+			tp->cp_cmd &= ~RxChkSum;
+			RTL_W16(CPlusCmd, tp->cp_cmd);
+		} else {
+			RTL_W8(Config3, RTL_R8(Config3) & ~Jumbo_En0);
+			RTL_W8(Config4, RTL_R8(Config4) & ~Jumbo_En1);
+
+			//Set PCI configuration space offset 0x79 to 0x50
+			/*Increase the Tx performance*/
+			pci_read_config_byte(pdev, 0x79, &device_control);
+			device_control &= ~0x70;
+			device_control |= 0x50;
+			pci_write_config_byte(pdev, 0x79, device_control);
+
+			//tx checksum offload enable
+			dev->features |= NETIF_F_IP_CSUM;
+
+			//rx checksum offload enable
+			tp->cp_cmd |= RxChkSum;
+			RTL_W16(CPlusCmd, tp->cp_cmd);
+		}
+	} else if (tp->mcfg == CFG_METHOD_7) {
+		/*set PCI configuration space offset 0x70F to 0x27*/
+		/*When the register offset of PCI configuration space larger than 0xff, use CSI to access it.*/
+		csi_tmp = rtl8168_csi_read(tp, 0x70c) & 0x00ffffff;
+		rtl8168_csi_write(tp, 0x70c, csi_tmp | 0x27000000);
+		rtl8168_eri_write(tp, 0x1EC, 1, 0x07, ERIAR_ASF);
+
+		//disable clock request.
+		pci_write_config_byte(pdev, 0x81, 0x00);
+
+		RTL_W16(CPlusCmd, RTL_R16(CPlusCmd) &
+			~(EnableBist | Macdbgo_oe | Force_halfdup | Force_rxflow_en | Force_txflow_en |
+			  Cxpl_dbg_sel | ASF | PktCntrDisable | Macdbgo_sel));
+
+		RTL_W8(Config3, RTL_R8(Config3) & ~Beacon_en);
+
+		RTL_W8(MTPS, Reserved1_data);
+		if (dev->mtu > ETH_DATA_LEN) {
+			RTL_W8(Config3, RTL_R8(Config3) | Jumbo_En0);
+			RTL_W8(Config4, RTL_R8(Config4) | Jumbo_En1);
+
+			//Set PCI configuration space offset 0x79 to 0x20
+			/*Increase the Tx performance*/
+			pci_read_config_byte(pdev, 0x79, &device_control);
+			device_control &= ~0x70;
+			device_control |= 0x20;
+			pci_write_config_byte(pdev, 0x79, device_control);
+
+			//tx checksum offload disable
+			dev->features &= ~NETIF_F_IP_CSUM;
+
+			//rx checksum offload disable
+			tp->cp_cmd &= ~RxChkSum;
+			RTL_W16(CPlusCmd, tp->cp_cmd);
+		} else {
+			RTL_W8(Config3, RTL_R8(Config3) & ~Jumbo_En0);
+			RTL_W8(Config4, RTL_R8(Config4) & ~Jumbo_En1);
+
+			//Set PCI configuration space offset 0x79 to 0x50
+			/*Increase the Tx performance*/
+			pci_read_config_byte(pdev, 0x79, &device_control);
+			device_control &= ~0x70;
+			device_control |= 0x50;
+			pci_write_config_byte(pdev, 0x79, device_control);
+
+			//tx checksum offload enable
+			dev->features |= NETIF_F_IP_CSUM;
+
+			//rx checksum offload enable
+			tp->cp_cmd |= RxChkSum;
+			RTL_W16(CPlusCmd, tp->cp_cmd);
+		}
+	} else if (tp->mcfg == CFG_METHOD_8) {
+		/*set PCI configuration space offset 0x70F to 0x27*/
+		/*When the register offset of PCI configuration space larger than 0xff, use CSI to access it.*/
+		csi_tmp = rtl8168_csi_read(tp, 0x70c) & 0x00ffffff;
+		rtl8168_csi_write(tp, 0x70c, csi_tmp | 0x27000000);
+		rtl8168_eri_write(tp, 0x1EC, 1, 0x07, ERIAR_ASF);
+
+		//disable clock request.
+		pci_write_config_byte(pdev, 0x81, 0x00);
+
+		RTL_W16(CPlusCmd, RTL_R16(CPlusCmd) &
+			~(EnableBist | Macdbgo_oe | Force_halfdup | Force_rxflow_en | Force_txflow_en |
+			  Cxpl_dbg_sel | ASF | PktCntrDisable | Macdbgo_sel));
+
+		RTL_W8(Config3, RTL_R8(Config3) & ~Beacon_en);
+
+		RTL_W8(0xD1, 0x20);
+
+		RTL_W8(MTPS, Reserved1_data);
+		if (dev->mtu > ETH_DATA_LEN) {
+			RTL_W8(Config3, RTL_R8(Config3) | Jumbo_En0);
+			RTL_W8(Config4, RTL_R8(Config4) | Jumbo_En1);
+
+			//Set PCI configuration space offset 0x79 to 0x20
+			/*Increase the Tx performance*/
+			pci_read_config_byte(pdev, 0x79, &device_control);
+			device_control &= ~0x70;
+			device_control |= 0x20;
+			pci_write_config_byte(pdev, 0x79, device_control);
+
+			//tx checksum offload disable
+			dev->features &= ~NETIF_F_IP_CSUM;
+
+			//rx checksum offload disable
+			tp->cp_cmd &= ~RxChkSum;
+			RTL_W16(CPlusCmd, tp->cp_cmd);
+		} else {
+			RTL_W8(Config3, RTL_R8(Config3) & ~Jumbo_En0);
+			RTL_W8(Config4, RTL_R8(Config4) & ~Jumbo_En1);
+
+			//Set PCI configuration space offset 0x79 to 0x50
+			/*Increase the Tx performance*/
+			pci_read_config_byte(pdev, 0x79, &device_control);
+			device_control &= ~0x70;
+			device_control |= 0x50;
+			pci_write_config_byte(pdev, 0x79, device_control);
+
+			//tx checksum offload enable
+			dev->features |= NETIF_F_IP_CSUM;
+
+			//rx checksum offload enable
+			tp->cp_cmd |= RxChkSum;
+			RTL_W16(CPlusCmd, tp->cp_cmd);
+		}
+
+	} else if (tp->mcfg == CFG_METHOD_9) {
+		/*set PCI configuration space offset 0x70F to 0x13*/
+		/*When the register offset of PCI configuration space larger than 0xff, use CSI to access it.*/
+		csi_tmp = rtl8168_csi_read(tp, 0x70c) & 0x00ffffff;
+		rtl8168_csi_write(tp, 0x70c, csi_tmp | 0x13000000);
+
+		/* disable clock request. */
+		pci_write_config_byte(pdev, 0x81, 0x00);
+
+		RTL_W8(Config3, RTL_R8(Config3) & ~BIT_4);
+		RTL_W8(DBG_reg, RTL_R8(DBG_reg) | BIT_7 | BIT_1);
+
+		RTL_W8(MTPS, Reserved1_data);
+		if (dev->mtu > ETH_DATA_LEN) {
+			RTL_W8(Config3, RTL_R8(Config3) | Jumbo_En0);
+			RTL_W8(Config4, RTL_R8(Config4) | Jumbo_En1);
+
+			/* Set PCI configuration space offset 0x79 to 0x20 */
+			pci_read_config_byte(pdev, 0x79, &device_control);
+			device_control &= ~0x70;
+			device_control |= 0x20;
+			pci_write_config_byte(pdev, 0x79, device_control);
+
+			/* tx checksum offload disable */
+			dev->features &= ~NETIF_F_IP_CSUM;
+
+			/* rx checksum offload disable */
+			tp->cp_cmd &= ~RxChkSum;
+			RTL_W16(CPlusCmd, tp->cp_cmd);
+		} else {
+			RTL_W8(Config3, RTL_R8(Config3) & ~Jumbo_En0);
+			RTL_W8(Config4, RTL_R8(Config4) & ~Jumbo_En1);
+
+			/* Set PCI configuration space offset 0x79 to 0x50 */
+			pci_read_config_byte(pdev, 0x79, &device_control);
+			device_control &= ~0x70;
+			device_control |= 0x50;
+			pci_write_config_byte(pdev, 0x79, device_control);
+
+			/* tx checksum offload enable */
+			dev->features |= NETIF_F_IP_CSUM;
+
+			/* rx checksum offload enable */
+			tp->cp_cmd |= RxChkSum;
+			RTL_W16(CPlusCmd, tp->cp_cmd);
+		}
+
+		/* set EPHY registers */
+		rtl8168_ephy_write(tp, 0x01, 0x7C7D);
+		rtl8168_ephy_write(tp, 0x02, 0x091F);
+		rtl8168_ephy_write(tp, 0x06, 0xB271);
+		rtl8168_ephy_write(tp, 0x07, 0xCE00);
+	} else if (tp->mcfg == CFG_METHOD_10) {
+		/*set PCI configuration space offset 0x70F to 0x13*/
+		/*When the register offset of PCI configuration space larger than 0xff, use CSI to access it.*/
+		csi_tmp = rtl8168_csi_read(tp, 0x70c) & 0x00ffffff;
+		rtl8168_csi_write(tp, 0x70c, csi_tmp | 0x13000000);
+
+		RTL_W8(DBG_reg, RTL_R8(DBG_reg) | BIT_7 | BIT_1);
+
+		RTL_W8(MTPS, Reserved1_data);
+		if (dev->mtu > ETH_DATA_LEN) {
+			RTL_W8(Config3, RTL_R8(Config3) | Jumbo_En0);
+			RTL_W8(Config4, RTL_R8(Config4) | Jumbo_En1);
+
+			/* Set PCI configuration space offset 0x79 to 0x20 */
+			pci_read_config_byte(pdev, 0x79, &device_control);
+			device_control &= ~0x70;
+			device_control |= 0x20;
+			pci_write_config_byte(pdev, 0x79, device_control);
+
+			/* tx checksum offload disable */
+			dev->features &= ~NETIF_F_IP_CSUM;
+
+			/* rx checksum offload disable */
+			tp->cp_cmd &= ~RxChkSum;
+			RTL_W16(CPlusCmd, tp->cp_cmd);
+		} else {
+			RTL_W8(Config3, RTL_R8(Config3) & ~Jumbo_En0);
+			RTL_W8(Config4, RTL_R8(Config4) & ~Jumbo_En1);
+
+			/* Set PCI configuration space offset 0x79 to 0x50 */
+			pci_read_config_byte(pdev, 0x79, &device_control);
+			device_control &= ~0x70;
+			device_control |= 0x50;
+			pci_write_config_byte(pdev, 0x79, device_control);
+
+			/* tx checksum offload enable */
+			dev->features |= NETIF_F_IP_CSUM;
+
+			/* rx checksum offload enable */
+			tp->cp_cmd |= RxChkSum;
+			RTL_W16(CPlusCmd, tp->cp_cmd);
+		}
+
+		RTL_W8(Config1, (RTL_R8(Config1)&0xC0) | 0x1F);
+
+		/* set EPHY registers */
+		rtl8168_ephy_write(tp, 0x01, 0x6C7F);
+		rtl8168_ephy_write(tp, 0x02, 0x011F);
+		rtl8168_ephy_write(tp, 0x03, 0xC1B2);
+		rtl8168_ephy_write(tp, 0x1A, 0x0546);
+		rtl8168_ephy_write(tp, 0x1C, 0x80C4);
+		rtl8168_ephy_write(tp, 0x1D, 0x78E4);
+		rtl8168_ephy_write(tp, 0x0A, 0x8100);
+
+		/* disable clock request. */
+		pci_write_config_byte(pdev, 0x81, 0x00);
+
+		RTL_W8(0xF3, RTL_R8(0xF3) | BIT_2);
+
+	} else if (tp->mcfg == CFG_METHOD_11) {
+		/*set PCI configuration space offset 0x70F to 0x37*/
+		/*When the register offset of PCI configuration space larger than 0xff, use CSI to access it.*/
+		csi_tmp = rtl8168_csi_read(tp, 0x70c) & 0x00ffffff;
+		rtl8168_csi_write(tp, 0x70c, csi_tmp | 0x17000000);
+
+		/* Set PCI configuration space offset 0x79 to 0x50 */
+		pci_read_config_byte(pdev, 0x79, &device_control);
+		device_control &= ~0x70;
+		device_control |= 0x50;
+		pci_write_config_byte(pdev, 0x79, device_control);
+
+		RTL_W8(MTPS, Reserved1_data);
+		if (dev->mtu > ETH_DATA_LEN) {
+			RTL_W8(Config3, RTL_R8(Config3) | Jumbo_En0);
+
+			/* tx checksum offload disable */
+			dev->features &= ~NETIF_F_IP_CSUM;
+
+			/* rx checksum offload disable */
+			tp->cp_cmd &= ~RxChkSum;
+			RTL_W16(CPlusCmd, tp->cp_cmd);
+		} else {
+			RTL_W8(Config3, RTL_R8(Config3) & ~Jumbo_En0);
+
+			/* tx checksum offload enable */
+			dev->features |= NETIF_F_IP_CSUM;
+
+			/* rx checksum offload enable */
+			tp->cp_cmd |= RxChkSum;
+			RTL_W16(CPlusCmd, tp->cp_cmd);
+		}
+
+		pci_write_config_byte(pdev, 0x81, 0x00);
+
+		RTL_W8(Config1, (RTL_R8(Config1)&0xC0)|0x1F);
+
+	} else if (tp->mcfg == CFG_METHOD_12) {
+		/*set PCI configuration space offset 0x70F to 0x37*/
+		/*When the register offset of PCI configuration space larger than 0xff, use CSI to access it.*/
+		csi_tmp = rtl8168_csi_read(tp, 0x70c) & 0x00ffffff;
+		rtl8168_csi_write(tp, 0x70c, csi_tmp | 0x17000000);
+
+		/* Set PCI configuration space offset 0x79 to 0x50 */
+		pci_read_config_byte(pdev, 0x79, &device_control);
+		device_control &= ~0x70;
+		device_control |= 0x50;
+		pci_write_config_byte(pdev, 0x79, device_control);
+
+		RTL_W8(MTPS, Reserved1_data);
+		if (dev->mtu > ETH_DATA_LEN) {
+			RTL_W8(Config3, RTL_R8(Config3) | Jumbo_En0);
+
+			/* tx checksum offload disable */
+			dev->features &= ~NETIF_F_IP_CSUM;
+
+			/* rx checksum offload disable */
+			tp->cp_cmd &= ~RxChkSum;
+			RTL_W16(CPlusCmd, tp->cp_cmd);
+		} else {
+			RTL_W8(Config3, RTL_R8(Config3) & ~Jumbo_En0);
+
+			/* tx checksum offload enable */
+			dev->features |= NETIF_F_IP_CSUM;
+
+			/* rx checksum offload enable */
+			tp->cp_cmd |= RxChkSum;
+			RTL_W16(CPlusCmd, tp->cp_cmd);
+		}
+
+		ephy_data = rtl8168_ephy_read(tp, 0x0B);
+		rtl8168_ephy_write(tp, 0x03, ephy_data|0x48);
+		ephy_data = rtl8168_ephy_read(tp, 0x19);
+		ephy_data &= 0x20;
+		rtl8168_ephy_write(tp, 0x03, ephy_data|0x50);
+		ephy_data = rtl8168_ephy_read(tp, 0x0C);
+		rtl8168_ephy_write(tp, 0x03, ephy_data|0x20);
+
+		pci_write_config_byte(pdev, 0x81, 0x01);
+
+		RTL_W8(Config1, (RTL_R8(Config1)&0xC0)|0x1F);
+
+	} else if (tp->mcfg == CFG_METHOD_14 || tp->mcfg == CFG_METHOD_15) {
+		/*set PCI configuration space offset 0x70F to 0x27*/
+		/*When the register offset of PCI configuration space larger than 0xff, use CSI to access it.*/
+		csi_tmp = rtl8168_csi_read(tp, 0x70c) & 0x00ffffff;
+		rtl8168_csi_write(tp, 0x70c, csi_tmp | 0x27000000);
+
+		/* set EPHY registers */
+		ephy_data = rtl8168_ephy_read(tp, 0x00) & ~0x0200;
+		ephy_data |= 0x0100;
+		rtl8168_ephy_write(tp, 0x00, ephy_data);
+
+		ephy_data = rtl8168_ephy_read(tp, 0x00);
+		ephy_data |= 0x0004;
+		rtl8168_ephy_write(tp, 0x00, ephy_data);
+
+		ephy_data = rtl8168_ephy_read(tp, 0x06) & ~0x0002;
+		ephy_data |= 0x0001;
+		rtl8168_ephy_write(tp, 0x06, ephy_data);
+
+		ephy_data = rtl8168_ephy_read(tp, 0x06);
+		ephy_data |= 0x0030;
+		rtl8168_ephy_write(tp, 0x06, ephy_data);
+
+		ephy_data = rtl8168_ephy_read(tp, 0x07);
+		ephy_data |= 0x2000;
+		rtl8168_ephy_write(tp, 0x07, ephy_data);
+
+		ephy_data = rtl8168_ephy_read(tp, 0x00);
+		ephy_data |= 0x0020;
+		rtl8168_ephy_write(tp, 0x00, ephy_data);
+
+		ephy_data = rtl8168_ephy_read(tp, 0x03) & ~0x5800;
+		ephy_data |= 0x2000;
+		rtl8168_ephy_write(tp, 0x03, ephy_data);
+
+		ephy_data = rtl8168_ephy_read(tp, 0x03);
+		ephy_data |= 0x0001;
+		rtl8168_ephy_write(tp, 0x03, ephy_data);
+
+		ephy_data = rtl8168_ephy_read(tp, 0x01) & ~0x0800;
+		ephy_data |= 0x1000;
+		rtl8168_ephy_write(tp, 0x01, ephy_data);
+
+		ephy_data = rtl8168_ephy_read(tp, 0x07);
+		ephy_data |= 0x4000;
+		rtl8168_ephy_write(tp, 0x07, ephy_data);
+
+		ephy_data = rtl8168_ephy_read(tp, 0x1E);
+		ephy_data |= 0x2000;
+		rtl8168_ephy_write(tp, 0x1E, ephy_data);
+
+		rtl8168_ephy_write(tp, 0x19, 0xFE6C);
+
+		ephy_data = rtl8168_ephy_read(tp, 0x0A);
+		ephy_data |= 0x0040;
+		rtl8168_ephy_write(tp, 0x0A, ephy_data);
+
+		tp->cp_cmd &= 0x2063;
+		if (dev->mtu > ETH_DATA_LEN) {
+			RTL_W8(MTPS, 0x24);
+			RTL_W8(Config3, RTL_R8(Config3) | Jumbo_En0);
+			RTL_W8(Config4, RTL_R8(Config4) | 0x01);
+			/* Set PCI configuration space offset 0x79 to 0x20 */
+			pci_write_config_byte(pdev, 0x79, 0x20);
+
+			/* tx checksum offload disable */
+			dev->features &= ~NETIF_F_IP_CSUM;
+
+			/* rx checksum offload disable */
+			tp->cp_cmd &= ~RxChkSum;
+			RTL_W16(CPlusCmd, tp->cp_cmd);
+		} else {
+			RTL_W8(MTPS, 0x0C);
+			RTL_W8(Config3, RTL_R8(Config3) & ~Jumbo_En0);
+			RTL_W8(Config4, RTL_R8(Config4) & ~0x01);
+			/* Set PCI configuration space offset 0x79 to 0x50 */
+			pci_write_config_byte(pdev, 0x79, 0x50);
+
+
+			/* tx checksum offload enable */
+			dev->features |= NETIF_F_IP_CSUM;
+
+			/* rx checksum offload enable */
+			tp->cp_cmd |= RxChkSum;
+			RTL_W16(CPlusCmd, tp->cp_cmd);
+		}
+		rtl8168_set_rxbufsize(tp, dev);
+
+
+//		RTL_W8(0xF2, RTL_R8(0xF2) | BIT_0);
+//		RTL_W32(CounterAddrLow, RTL_R32(CounterAddrLow) | BIT_0);
+
+		RTL_W8(0xF3, RTL_R8(0xF3) | BIT_5);
+		RTL_W8(0xF3, RTL_R8(0xF3) & ~BIT_5);
+
+//		RTL_W8(0xD3, RTL_R8(0xD3) | BIT_3 | BIT_2);
+
+		RTL_W8(0xD0, RTL_R8(0xD0) | BIT_7 | BIT_6);
+
+		RTL_W8(0xF1, RTL_R8(0xF1) | BIT_7 | BIT_6 | BIT_5 | BIT_4 | BIT_2 | BIT_1);
+
+		RTL_W8(Config5, (RTL_R8(Config5)&~0x08) | BIT_0);
+		RTL_W8(Config2, RTL_R8(Config2) | BIT_7);
+
+		RTL_W8(Config3, RTL_R8(Config3) & ~Beacon_en);
+	} else if (tp->mcfg == CFG_METHOD_1) {
+		RTL_W8(Config3, RTL_R8(Config3) & ~Beacon_en);
+
+		RTL_W16(CPlusCmd, RTL_R16(CPlusCmd) &
+			~(EnableBist | Macdbgo_oe | Force_halfdup | Force_rxflow_en | Force_txflow_en |
+			  Cxpl_dbg_sel | ASF | PktCntrDisable | Macdbgo_sel));
+
+		if (dev->mtu > ETH_DATA_LEN) {
+			pci_read_config_byte(pdev, 0x69, &device_control);
+			device_control &= ~0x70;
+			device_control |= 0x28;
+			pci_write_config_byte(pdev, 0x69, device_control);
+		} else {
+			pci_read_config_byte(pdev, 0x69, &device_control);
+			device_control &= ~0x70;
+			device_control |= 0x58;
+			pci_write_config_byte(pdev, 0x69, device_control);
+		}
+	} else if (tp->mcfg == CFG_METHOD_2) {
+		RTL_W8(Config3, RTL_R8(Config3) & ~Beacon_en);
+
+		RTL_W16(CPlusCmd, RTL_R16(CPlusCmd) &
+			~(EnableBist | Macdbgo_oe | Force_halfdup | Force_rxflow_en | Force_txflow_en |
+			  Cxpl_dbg_sel | ASF | PktCntrDisable | Macdbgo_sel));
+
+		RTL_W8(MTPS, Reserved1_data);
+		if (dev->mtu > ETH_DATA_LEN) {
+			pci_read_config_byte(pdev, 0x69, &device_control);
+			device_control &= ~0x70;
+			device_control |= 0x28;
+			pci_write_config_byte(pdev, 0x69, device_control);
+
+			RTL_W8(Config4, RTL_R8(Config4) | (1 << 0));
+		} else {
+			pci_read_config_byte(pdev, 0x69, &device_control);
+			device_control &= ~0x70;
+			device_control |= 0x58;
+			pci_write_config_byte(pdev, 0x69, device_control);
+
+			RTL_W8(Config4, RTL_R8(Config4) & ~(1 << 0));
+		}
+	} else if (tp->mcfg == CFG_METHOD_3) {
+		RTL_W8(Config3, RTL_R8(Config3) & ~Beacon_en);
+
+		RTL_W16(CPlusCmd, RTL_R16(CPlusCmd) &
+			~(EnableBist | Macdbgo_oe | Force_halfdup | Force_rxflow_en | Force_txflow_en |
+			  Cxpl_dbg_sel | ASF | PktCntrDisable | Macdbgo_sel));
+
+		RTL_W8(MTPS, Reserved1_data);
+		if (dev->mtu > ETH_DATA_LEN) {
+			pci_read_config_byte(pdev, 0x69, &device_control);
+			device_control &= ~0x70;
+			device_control |= 0x28;
+			pci_write_config_byte(pdev, 0x69, device_control);
+
+			RTL_W8(Config4, RTL_R8(Config4) | (1 << 0));
+		} else {
+			pci_read_config_byte(pdev, 0x69, &device_control);
+			device_control &= ~0x70;
+			device_control |= 0x58;
+			pci_write_config_byte(pdev, 0x69, device_control);
+
+			RTL_W8(Config4, RTL_R8(Config4) & ~(1 << 0));
+		}
+	}
+}
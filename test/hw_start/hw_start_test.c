@@ -0,0 +1,299 @@
+/*
+ * Check the hw_start init programs against the per-chip code they
+ * replaced.  For every chip, MTU class and starting register pattern the
+ * reference code and rtl8168_run_init_prog() run against the same
+ * register model; their write logs and end states must match.  The
+ * journal recorded by the full run is then replayed onto a fresh model
+ * and must reach the same end state.
+ *
+ * Only the per-chip section is covered: the common prologue and epilogue
+ * of hw_start are shared by both versions.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "kshim.h"
+#include "r8168.h"
+
+#define LOG_MAX		256
+
+struct reg_write {
+	char	type;		/* b/w/l MMIO, p PCI config, e EPHY, c CSI, r ERI */
+	u16	reg;
+	u32	val;
+};
+
+struct model {
+	u8	mac[256];
+	u8	pci[256];
+	u32	csi[0x1000 / 4];
+	u16	ephy[32];
+	u32	eri[0x200 / 4];
+
+	struct reg_write log[LOG_MAX];
+	int	log_len;
+};
+
+static struct model m;
+static u8 mmio_base[256];
+
+static void
+log_write(char type, u16 reg, u32 val)
+{
+	if (m.log_len >= LOG_MAX) {
+		fprintf(stderr, "write log overflow\n");
+		exit(2);
+	}
+	m.log[m.log_len].type = type;
+	m.log[m.log_len].reg = reg;
+	m.log[m.log_len].val = val;
+	m.log_len++;
+}
+
+static u16
+mmio_reg(void __iomem *addr)
+{
+	return (u8 *)addr - mmio_base;
+}
+
+void writeb(u8 val, void __iomem *addr)
+{
+	u16 reg = mmio_reg(addr);
+
+	m.mac[reg] = val;
+	log_write('b', reg, val);
+}
+
+void writew(u16 val, void __iomem *addr)
+{
+	u16 reg = mmio_reg(addr);
+
+	memcpy(&m.mac[reg], &val, sizeof(val));
+	log_write('w', reg, val);
+}
+
+void writel(u32 val, void __iomem *addr)
+{
+	u16 reg = mmio_reg(addr);
+
+	memcpy(&m.mac[reg], &val, sizeof(val));
+	log_write('l', reg, val);
+}
+
+u8 readb(void __iomem *addr)
+{
+	return m.mac[mmio_reg(addr)];
+}
+
+u16 readw(void __iomem *addr)
+{
+	u16 val;
+
+	memcpy(&val, &m.mac[mmio_reg(addr)], sizeof(val));
+	return val;
+}
+
+u32 readl(void __iomem *addr)
+{
+	u32 val;
+
+	memcpy(&val, &m.mac[mmio_reg(addr)], sizeof(val));
+	return val;
+}
+
+int pci_read_config_byte(struct pci_dev *pdev, int where, u8 *val)
+{
+	*val = m.pci[where];
+	return 0;
+}
+
+int pci_write_config_byte(struct pci_dev *pdev, int where, u8 val)
+{
+	m.pci[where] = val;
+	log_write('p', where, val);
+	return 0;
+}
+
+static void
+rtl8168_ephy_write(struct rtl8168_private *tp, int RegAddr, int value)
+{
+	m.ephy[RegAddr & 0x1f] = value;
+	log_write('e', RegAddr, value & 0xffff);
+}
+
+static u16
+rtl8168_ephy_read(struct rtl8168_private *tp, int RegAddr)
+{
+	return m.ephy[RegAddr & 0x1f];
+}
+
+static void
+rtl8168_csi_write(struct rtl8168_private *tp, int addr, int value)
+{
+	m.csi[(addr & 0xfff) >> 2] = value;
+	log_write('c', addr, value);
+}
+
+static int
+rtl8168_csi_read(struct rtl8168_private *tp, int addr)
+{
+	return m.csi[(addr & 0xfff) >> 2];
+}
+
+int rtl8168_eri_write(struct rtl8168_private *tp, int addr, int len, u32 value, int type)
+{
+	m.eri[(addr & 0x1ff) >> 2] = value;
+	log_write('r', addr, (len << 24) | value);
+	return 0;
+}
+
+static inline u64
+rtl8168_get_time_ns(void)
+{
+	return 0;
+}
+
+/* Rx buffer sizing moved to the common hw_start prologue */
+static void
+rtl8168_set_rxbufsize(struct rtl8168_private *tp, struct net_device *dev)
+{
+}
+
+#include "r8168_init.h"
+#include "hw_start_ref.h"
+
+struct state {
+	struct model	m;
+	unsigned long	features;
+	u16		cp_cmd;
+};
+
+static struct net_device netdev;
+static struct pci_dev pcidev;
+static struct rtl8168_private priv;
+
+static void
+seed(int pattern, unsigned int mtu)
+{
+	u32 x = 0x2545f491;
+	u8 *p = (u8 *)&m;
+	size_t i;
+
+	memset(&m, 0, sizeof(m));
+	for (i = 0; i < offsetof(struct model, log); i++) {
+		x = x * 1103515245 + 12345;
+		p[i] = pattern == 0 ? 0x00 : pattern == 1 ? 0xff : x >> 16;
+	}
+
+	memset(&netdev, 0, sizeof(netdev));
+	strcpy(netdev.name, "eth0");
+	netdev.mtu = mtu;
+	netdev.features = pattern == 1 ? ~0UL : 0;
+
+	memset(&priv, 0, sizeof(priv));
+	priv.dev = &netdev;
+	priv.pci_dev = &pcidev;
+	priv.mmio_addr = mmio_base;
+	priv.cp_cmd = pattern == 1 ? 0xffff : (pattern == 2 ? 0x2a5c : 0);
+}
+
+static void
+snapshot(struct state *s)
+{
+	s->m = m;
+	s->features = netdev.features;
+	s->cp_cmd = priv.cp_cmd;
+}
+
+static int
+compare(const char *what, int mcfg, unsigned int mtu, int pattern,
+	const struct state *a, const struct state *b, int cmp_log)
+{
+	int i;
+
+	if (cmp_log) {
+		for (i = 0; i < a->m.log_len || i < b->m.log_len; i++) {
+			const struct reg_write *x = i < a->m.log_len ? &a->m.log[i] : NULL;
+			const struct reg_write *y = i < b->m.log_len ? &b->m.log[i] : NULL;
+
+			if (x && y && !memcmp(x, y, sizeof(*x)))
+				continue;
+
+			printf("FAIL %s CFG_METHOD_%d mtu %u pattern %d: write %d ",
+			       what, mcfg + 1, mtu, pattern, i);
+			if (x)
+				printf("%c %#05x <- %#010x", x->type, x->reg, x->val);
+			else
+				printf("(none)");
+			printf(" vs ");
+			if (y)
+				printf("%c %#05x <- %#010x\n", y->type, y->reg, y->val);
+			else
+				printf("(none)\n");
+			return 1;
+		}
+	}
+
+	if (memcmp(&a->m, &b->m, offsetof(struct model, log)) ||
+	    a->features != b->features || a->cp_cmd != b->cp_cmd) {
+		printf("FAIL %s CFG_METHOD_%d mtu %u pattern %d: end state differs\n",
+		       what, mcfg + 1, mtu, pattern);
+		return 1;
+	}
+
+	return 0;
+}
+
+int main(void)
+{
+	static const unsigned int mtus[] = { ETH_DATA_LEN, 9000 };
+	static struct state ref, prog, replay;
+	static struct rtl8168_init_op journal[R8168_INIT_JOURNAL_MAX + 1];
+	int mcfg, pattern, i, fail = 0, runs = 0;
+
+	for (mcfg = CFG_METHOD_1; mcfg < CFG_METHOD_MAX; mcfg++) {
+		for (i = 0; i < 2; i++) {
+			for (pattern = 0; pattern < 3; pattern++) {
+				seed(pattern, mtus[i]);
+				priv.mcfg = mcfg;
+				rtl8168_hw_start_ref(&priv);
+				snapshot(&ref);
+
+				seed(pattern, mtus[i]);
+				priv.mcfg = mcfg;
+				if (rtl8168_init_progs[mcfg]) {
+					priv.init_journal_len = 0;
+					priv.init_journal_valid = 1;
+					rtl8168_run_init_prog(&priv, rtl8168_init_progs[mcfg], 1);
+					priv.init_journal[priv.init_journal_len].type = RTL_INIT_END;
+				}
+				snapshot(&prog);
+
+				fail |= compare("prog", mcfg, mtus[i], pattern, &ref, &prog, 1);
+				runs++;
+
+				if (!rtl8168_init_progs[mcfg])
+					continue;
+
+				if (!priv.init_journal_valid) {
+					printf("FAIL journal CFG_METHOD_%d mtu %u: overflow\n",
+					       mcfg + 1, mtus[i]);
+					fail = 1;
+					continue;
+				}
+
+				memcpy(journal, priv.init_journal, sizeof(journal));
+				seed(pattern, mtus[i]);
+				priv.mcfg = mcfg;
+				rtl8168_run_init_prog(&priv, journal, 0);
+				snapshot(&replay);
+
+				fail |= compare("replay", mcfg, mtus[i], pattern, &prog, &replay, 0);
+			}
+		}
+	}
+
+	printf("%s: %d runs\n", fail ? "FAIL" : "ok", runs);
+	return fail;
+}
@@ -0,0 +1,60 @@
+/*
+ * Userspace stand-ins for the kernel definitions r8168.h and
+ * r8168_init.h need.  Register and config space accesses go to the
+ * model in hw_start_test.c.
+ */
+
+#ifndef _KSHIM_H
+#define _KSHIM_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#define LINUX_VERSION_CODE	KERNEL_VERSION(4,19,0)
+#define KERNEL_VERSION(a,b,c)	(((a) << 16) + ((b) << 8) + (c))
+
+#define __iomem
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+typedef int16_t s16;
+typedef int32_t s32;
+typedef uint64_t dma_addr_t;
+
+typedef struct { int unused; } spinlock_t;
+struct list_head { struct list_head *next, *prev; };
+struct work_struct { int unused; };
+struct delayed_work { int unused; };
+struct mutex { int unused; };
+struct hrtimer { int unused; };
+struct net_device_stats { unsigned long unused; };
+struct ethtool_cmd;
+struct pci_dev { int unused; };
+
+#define ETH_DATA_LEN		1500
+#define NETIF_F_IP_CSUM		2
+
+struct net_device {
+	char		name[16];
+	unsigned int	mtu;
+	unsigned long	features;
+};
+
+#define printk			printf
+#define KERN_DEBUG		""
+#define netif_msg_hw(tp)	0
+
+void writeb(u8 val, void __iomem *addr);
+void writew(u16 val, void __iomem *addr);
+void writel(u32 val, void __iomem *addr);
+u8 readb(void __iomem *addr);
+u16 readw(void __iomem *addr);
+u32 readl(void __iomem *addr);
+
+int pci_read_config_byte(struct pci_dev *pdev, int where, u8 *val);
+int pci_write_config_byte(struct pci_dev *pdev, int where, u8 val);
+
+#endif /* _KSHIM_H */